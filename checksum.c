@@ -0,0 +1,118 @@
+#include <string.h>
+#include <pthread.h>
+#include "checksum.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define HAVE_X86_CRC 1
+#endif
+
+#define CRC32C_POLY 0x82F63B78u
+
+// slicing-by-8 tables for the scalar kernel
+static uint32_t crc_table[8][256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void init_crc_table(void) {
+    for (int i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        }
+        crc_table[0][i] = c;
+    }
+    for (int i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) {
+            crc_table[t][i] = (crc_table[t - 1][i] >> 8) ^ crc_table[0][crc_table[t - 1][i] & 0xFF];
+        }
+    }
+}
+
+uint32_t crc32c_sw(uint32_t crc, const void* data, size_t len) {
+    const unsigned char* p = data;
+    pthread_once(&crc_table_once, init_crc_table);
+    crc = ~crc;
+    // byte at a time until aligned
+    while (len > 0 && ((uintptr_t)p & 7) != 0) {
+        crc = (crc >> 8) ^ crc_table[0][(crc ^ *p++) & 0xFF];
+        len--;
+    }
+    while (len >= 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = crc_table[7][lo & 0xFF] ^ crc_table[6][(lo >> 8) & 0xFF] ^
+              crc_table[5][(lo >> 16) & 0xFF] ^ crc_table[4][lo >> 24] ^
+              crc_table[3][hi & 0xFF] ^ crc_table[2][(hi >> 8) & 0xFF] ^
+              crc_table[1][(hi >> 16) & 0xFF] ^ crc_table[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len > 0) {
+        crc = (crc >> 8) ^ crc_table[0][(crc ^ *p++) & 0xFF];
+        len--;
+    }
+    return ~crc;
+}
+
+#ifdef HAVE_X86_CRC
+__attribute__((target("sse4.2")))
+uint32_t crc32c_hw(uint32_t crc, const void* data, size_t len) {
+    const unsigned char* p = data;
+    crc = ~crc;
+    while (len > 0 && ((uintptr_t)p & 7) != 0) {
+        crc = _mm_crc32_u8(crc, *p++);
+        len--;
+    }
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc64;
+#endif
+    while (len >= 4) {
+        uint32_t word;
+        memcpy(&word, p, 4);
+        crc = _mm_crc32_u32(crc, word);
+        p += 4;
+        len -= 4;
+    }
+    while (len > 0) {
+        crc = _mm_crc32_u8(crc, *p++);
+        len--;
+    }
+    return ~crc;
+}
+
+int crc32c_hw_available(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+}
+#else
+uint32_t crc32c_hw(uint32_t crc, const void* data, size_t len) {
+    return crc32c_sw(crc, data, len);
+}
+
+int crc32c_hw_available(void) {
+    return 0;
+}
+#endif
+
+// pick the kernel once, on first use
+static uint32_t (*crc32c_impl)(uint32_t, const void*, size_t);
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static void select_crc32c(void) {
+    crc32c_impl = crc32c_hw_available() ? crc32c_hw : crc32c_sw;
+}
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t len) {
+    pthread_once(&crc32c_once, select_crc32c);
+    return crc32c_impl(crc, data, len);
+}
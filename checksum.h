@@ -0,0 +1,19 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// content is checksummed in blocks of this size
+#define CHECKSUM_BLOCK_SIZE 4096
+
+// CRC32C (Castagnoli). crc is the value returned by a previous call (0 to start),
+// so a block can be extended as more data arrives.
+uint32_t crc32c(uint32_t crc, const void* data, size_t len);
+
+// the kernels behind crc32c(), exposed for the benchmark
+uint32_t crc32c_sw(uint32_t crc, const void* data, size_t len);
+uint32_t crc32c_hw(uint32_t crc, const void* data, size_t len);
+int crc32c_hw_available(void);
+
+#endif
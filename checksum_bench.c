@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "checksum.h"
+
+#define BENCH_SIZE (64 * 1024 * 1024)
+#define BENCH_ROUNDS 8
+
+static double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// run one kernel over the buffer in CHECKSUM_BLOCK_SIZE pieces, like the server does
+static void run_kernel(const char* name, uint32_t (*kernel)(uint32_t, const void*, size_t), const char* buf) {
+    uint32_t result = 0;
+    double start = now_sec();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        for (size_t off = 0; off < BENCH_SIZE; off += CHECKSUM_BLOCK_SIZE) {
+            result += kernel(0, buf + off, CHECKSUM_BLOCK_SIZE);
+        }
+    }
+    double elapsed = now_sec() - start;
+    double gbytes = (double)BENCH_SIZE * BENCH_ROUNDS / 1e9;
+    printf("%-10s %8.2f GB/s  (sum of block crcs %08x)\n", name, gbytes / elapsed, result);
+}
+
+int main() {
+    char* buf = malloc(BENCH_SIZE);
+    if (buf == NULL) {
+        perror("Failed to allocate benchmark buffer");
+        exit(EXIT_FAILURE);
+    }
+    srand(1);
+    for (size_t i = 0; i < BENCH_SIZE; i++) {
+        buf[i] = (char)rand();
+    }
+
+    // "123456789" is the standard CRC32C check value, crc32c_hw only runs where the CPU has it
+    if (crc32c_sw(0, "123456789", 9) != 0xE3069283u ||
+        (crc32c_hw_available() && crc32c_hw(0, "123456789", 9) != 0xE3069283u)) {
+        printf("CRC32C self-test failed.\n");
+        free(buf);
+        return 1;
+    }
+
+    printf("CRC32C, %d MB x %d rounds, %d byte blocks, single core\n", BENCH_SIZE >> 20, BENCH_ROUNDS, CHECKSUM_BLOCK_SIZE);
+    run_kernel("scalar", crc32c_sw, buf);
+    if (crc32c_hw_available()) {
+        run_kernel("sse4.2", crc32c_hw, buf);
+    }
+    else {
+        printf("sse4.2     not supported on this CPU\n");
+    }
+    free(buf);
+    return 0;
+}
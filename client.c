@@ -4,6 +4,9 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <termios.h>
+#include <signal.h>
+#include "checksum.h"
+#include "fm_client.h"
 
 #define PORT 12350
 #define BUFFER_SIZE 512*1024
@@ -30,7 +33,7 @@ void handle_commands(int sockfd) {
 
     while (1) {
         printf("\n");
-        printf("Enter command (create/read/write/mode/exit): ");
+        printf("Enter command (create/read/write/mode/stats/exit): ");
         memset(command, 0, sizeof(command));
         if (!fgets(command, sizeof(command), stdin)) {
             break;
@@ -47,6 +50,12 @@ void handle_commands(int sockfd) {
         send(sockfd, command, strlen(command), 0);
    
         if (strncmp(command, "read", 4) == 0) {
+            // "read <filename> c" asks the server for a checksum to verify against
+            char read_cmd[10], read_file[50], verify[2] = { 0 };
+            int want_checksum = sscanf(command, "%9s %49s %1s", read_cmd, read_file, verify) == 3 && strcmp(verify, "c") == 0;
+            int have_checksum = 0;
+            unsigned int expected_crc = 0;
+            uint32_t actual_crc = 0;
             // keep receiving content until find "END OF FILE" 
             while (1) {
                 memset(buffer, 0, sizeof(buffer));
@@ -57,18 +66,33 @@ void handle_commands(int sockfd) {
                     return; // end handle_commands()
                 }
                 buffer[bytes_received] = '\0';
+                char* content_start = buffer;
+                // checksum line comes before the content
+                if (want_checksum && !have_checksum && sscanf(buffer, "CRC32C %x", &expected_crc) == 1) {
+                    have_checksum = 1;
+                    content_start = strchr(buffer, '\n') + 1;
+                }
 
                 // find "END_OF_FILE" 
-                char* end_marker = strstr(buffer, "END_OF_FILE");
+                char* end_marker = strstr(content_start, "END_OF_FILE");
                 if (end_marker != NULL) {
                     // convert "END_OF_FILE" to '\0'
                     *end_marker = '\0';
-                    printf("%s", buffer);
+                }
+                if (have_checksum) {
+                    actual_crc = crc32c(actual_crc, content_start, strlen(content_start));
+                }
+                printf("%s", content_start);
+                if (end_marker != NULL) {
                     break; // back to "enter command..."
                 }
+            }
+            if (have_checksum) {
+                if (actual_crc == expected_crc) {
+                    printf("\nChecksum verified (%08x).\n", actual_crc);
+                }
                 else {
-                    // if no "END_OF_FILE" , just print content
-                    printf("%s", buffer);
+                    printf("\nChecksum mismatch: expected %08x, received %08x.\n", expected_crc, actual_crc);
                 }
             }
         }
@@ -118,29 +142,37 @@ void handle_commands(int sockfd) {
         }
     }
 }
-int main() {
+int main(int argc, char* argv[]) {
     int sockfd;
-    struct sockaddr_in server_addr;
-    char buffer[BUFFER_SIZE];
+    // ./client [host] [port], so replicas on other ports can be used
+    const char* host = argc > 1 ? argv[1] : "127.0.0.1";
+    int port = argc > 2 ? atoi(argv[2]) : PORT;
+    // FM_SESSION=<token> skips the login and resumes that session
+    const char* resume = getenv("FM_SESSION");
     char username[20], group[20];
+    char session[SESSION_TOKEN_SIZE];
     int group_choice;
 
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    // report a closed connection instead of dying on the next send
+    signal(SIGPIPE, SIG_IGN);
+    sockfd = fm_connect(host, port);
     if (sockfd == -1) {
-        perror("Socket creation failed");
-        exit(EXIT_FAILURE);
-    }
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(PORT);
-    server_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
-
-    if (connect(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
         perror("Connection to server failed");
-        close(sockfd);
         exit(EXIT_FAILURE);
     }
 
     printf("Connected to the server.\n");
+    if (resume != NULL && resume[0] != '\0') {
+        if (!fm_resume(sockfd, resume)) {
+            printf("Server disconnected.\n");
+            close(sockfd);
+            exit(EXIT_FAILURE);
+        }
+        printf("Resuming session %s\n", resume);
+        handle_commands(sockfd);
+        close(sockfd);
+        return 0;
+    }
     printf("\n");
     printf("Enter username: ");
     if (!fgets(username, sizeof(username), stdin)) {
@@ -172,27 +204,24 @@ int main() {
         exit(EXIT_FAILURE);
     }
 
-    snprintf(buffer, sizeof(buffer), "%s|%s", username, group);
-    send(sockfd, buffer, strlen(buffer), 0);
-    // receive group validation outcome
-    memset(buffer, 0, sizeof(buffer));
-    int bytes_received = recv(sockfd, buffer, sizeof(buffer) - 1, 0);
-    if (bytes_received <= 0) {
+    int login = fm_login(sockfd, username, group, session);
+    if (login < 0) {
         printf("Server disconnected.\n");
         close(sockfd);
         exit(EXIT_FAILURE);
     }
-    buffer[bytes_received] = '\0';
-    printf("%s", buffer);
-    if (strstr(buffer, "Invalid group")) {
+    if (login == 0) {
+        printf("Invalid username or group\n");
         close(sockfd);
         exit(EXIT_FAILURE);
     }
+    printf("\nSession: %s (set FM_SESSION to resume it)\n", session);
     printf("Acceptable commands:\n");
     printf("1. create <filename> <permission>\n");
-    printf("2. read <filename>\n");
+    printf("2. read <filename> [c]\n");
     printf("3. write <filename> o/a\n");
     printf("4. mode <filename> <permission>\n");
+    printf("5. stats\n");
     
     handle_commands(sockfd);
     close(sockfd);
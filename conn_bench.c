@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "fm_client.h"
+
+#define PORT 12350
+#define MAX_THREADS 64
+
+// how each operation gets its connection
+enum { MODE_LOGIN, MODE_RESUME, MODE_POOL };
+const char* MODE_NAMES[] = { "login", "resume", "pooled" };
+
+const char* host = "127.0.0.1";
+int port = PORT;
+int seconds = 1;
+int mode;
+char session[SESSION_TOKEN_SIZE];
+pthread_mutex_t session_lock = PTHREAD_MUTEX_INITIALIZER;
+FmPool* pool;
+volatile int running;
+
+static double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// one "stats" round trip so every mode does the same useful work
+static int request(int sockfd) {
+    char reply[1024];
+    if (send(sockfd, "stats", 5, MSG_NOSIGNAL) <= 0) {
+        return 0;
+    }
+    return recv(sockfd, reply, sizeof(reply), 0) > 0 && strncmp(reply, "Role", 4) == 0;
+}
+
+// log in for a new session token, the old one may have been evicted by the logins before
+static int refresh_session() {
+    char token[SESSION_TOKEN_SIZE];
+    int sockfd = fm_connect(host, port);
+    if (sockfd == -1) {
+        return 0;
+    }
+    int ok = fm_login(sockfd, "bench", "AOS-students", token) == 1;
+    send(sockfd, "exit", 4, MSG_NOSIGNAL);
+    close(sockfd);
+    if (ok) {
+        pthread_mutex_lock(&session_lock);
+        strcpy(session, token);
+        pthread_mutex_unlock(&session_lock);
+    }
+    return ok;
+}
+
+static void* worker(void* arg) {
+    long* ops = arg;
+    char token[SESSION_TOKEN_SIZE];
+    char reply[1024];
+    while (running) {
+        if (mode == MODE_POOL) {
+            if (fm_pool_request(pool, "stats", reply, sizeof(reply)) > 0 && strncmp(reply, "Role", 4) == 0) {
+                (*ops)++;
+            }
+            continue;
+        }
+        int sockfd = fm_connect(host, port);
+        if (sockfd == -1) {
+            continue;
+        }
+        int ok;
+        if (mode == MODE_LOGIN) {
+            ok = fm_login(sockfd, "bench", "AOS-students", token) == 1;
+        }
+        else {
+            pthread_mutex_lock(&session_lock);
+            strcpy(token, session);
+            pthread_mutex_unlock(&session_lock);
+            ok = fm_resume(sockfd, token);
+        }
+        if (ok && request(sockfd)) {
+            (*ops)++;
+        }
+        else if (mode == MODE_RESUME) {
+            refresh_session();
+        }
+        send(sockfd, "exit", 4, MSG_NOSIGNAL);
+        close(sockfd);
+    }
+    return NULL;
+}
+
+int main(int argc, char* argv[]) {
+    // ./conn_bench [host] [port] [threads] [seconds], against a running server
+    int threads = 4;
+    if (argc > 1) {
+        host = argv[1];
+    }
+    if (argc > 2) {
+        port = atoi(argv[2]);
+    }
+    if (argc > 3) {
+        threads = atoi(argv[3]);
+    }
+    if (argc > 4) {
+        seconds = atoi(argv[4]);
+    }
+    if (threads < 1 || threads > MAX_THREADS || seconds < 1) {
+        fprintf(stderr, "Usage: %s [host] [port] [threads 1-%d] [seconds]\n", argv[0], MAX_THREADS);
+        exit(EXIT_FAILURE);
+    }
+
+    // a session to resume, and a pool that logs in on first use
+    if (!refresh_session()) {
+        perror("Connection to server failed");
+        exit(EXIT_FAILURE);
+    }
+    pool = fm_pool_create(host, port, "bench", "AOS-students");
+    if (pool == NULL) {
+        perror("Failed to create pool");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%d thread(s), %d second(s) per mode, one stats request per operation\n", threads, seconds);
+    for (mode = MODE_LOGIN; mode <= MODE_POOL; mode++) {
+        pthread_t tids[MAX_THREADS];
+        long ops[MAX_THREADS] = { 0 };
+        running = 1;
+        double start = now_sec();
+        for (int i = 0; i < threads; i++) {
+            pthread_create(&tids[i], NULL, worker, &ops[i]);
+        }
+        sleep(seconds);
+        running = 0;
+        long total = 0;
+        for (int i = 0; i < threads; i++) {
+            pthread_join(tids[i], NULL);
+            total += ops[i];
+        }
+        double elapsed = now_sec() - start;
+        printf("%-8s %10.0f ops/sec\n", MODE_NAMES[mode], total / elapsed);
+    }
+    fm_pool_destroy(pool);
+    return 0;
+}
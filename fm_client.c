@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include "fm_client.h"
+
+int fm_connect(const char* host, int port) {
+    char service[16];
+    struct addrinfo hints = { 0 }, *res;
+    // the server only listens on IPv4
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(service, sizeof(service), "%d", port);
+    if (getaddrinfo(host, service, &hints, &res) != 0) {
+        // getaddrinfo doesn't set errno, callers report failures with perror
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+    int sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (sockfd == -1) {
+        freeaddrinfo(res);
+        return -1;
+    }
+    int connected = connect(sockfd, res->ai_addr, res->ai_addrlen) == 0;
+    freeaddrinfo(res);
+    if (!connected) {
+        close(sockfd);
+        return -1;
+    }
+    // commands are small, don't let them wait for the previous ack
+    int on = 1;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return sockfd;
+}
+
+int fm_login(int sockfd, const char* username, const char* group, char* session) {
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer), "%s|%s", username, group);
+    if (send(sockfd, buffer, strlen(buffer), MSG_NOSIGNAL) <= 0) {
+        return -1;
+    }
+    // receive group validation outcome
+    memset(buffer, 0, sizeof(buffer));
+    int bytes_received = recv(sockfd, buffer, sizeof(buffer) - 1, 0);
+    if (bytes_received <= 0) {
+        return -1;
+    }
+    buffer[bytes_received] = '\0';
+    if (strstr(buffer, "Invalid group") || strstr(buffer, "Invalid username")) {
+        return 0;
+    }
+    session[0] = '\0';
+    sscanf(buffer, "SESSION %32s", session);
+    return 1;
+}
+
+int fm_resume(int sockfd, const char* session) {
+    char buffer[SESSION_TOKEN_SIZE + 2];
+    snprintf(buffer, sizeof(buffer), "@%s\n", session);
+    return send(sockfd, buffer, strlen(buffer), MSG_NOSIGNAL) > 0;
+}
+
+FmPool* fm_pool_create(const char* host, int port, const char* username, const char* group) {
+    FmPool* pool = calloc(1, sizeof(FmPool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    snprintf(pool->host, sizeof(pool->host), "%s", host);
+    pool->port = port;
+    snprintf(pool->username, sizeof(pool->username), "%s", username);
+    snprintf(pool->group, sizeof(pool->group), "%s", group);
+    pthread_mutex_init(&pool->lock, NULL);
+    return pool;
+}
+
+int fm_pool_get(FmPool* pool) {
+    char session[SESSION_TOKEN_SIZE];
+    pthread_mutex_lock(&pool->lock);
+    if (pool->idle_count > 0) {
+        int sockfd = pool->idle[--pool->idle_count];
+        pthread_mutex_unlock(&pool->lock);
+        return sockfd;
+    }
+    strcpy(session, pool->session);
+    pthread_mutex_unlock(&pool->lock);
+
+    int sockfd = fm_connect(pool->host, pool->port);
+    if (sockfd == -1) {
+        return -1;
+    }
+    if (session[0] != '\0') {
+        if (!fm_resume(sockfd, session)) {
+            close(sockfd);
+            return -1;
+        }
+        return sockfd;
+    }
+    if (fm_login(sockfd, pool->username, pool->group, session) != 1) {
+        close(sockfd);
+        return -1;
+    }
+    pthread_mutex_lock(&pool->lock);
+    strcpy(pool->session, session);
+    pthread_mutex_unlock(&pool->lock);
+    return sockfd;
+}
+
+void fm_pool_put(FmPool* pool, int sockfd) {
+    pthread_mutex_lock(&pool->lock);
+    if (pool->idle_count < MAX_POOL_CONNECTIONS) {
+        pool->idle[pool->idle_count++] = sockfd;
+        sockfd = -1;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if (sockfd != -1) {
+        send(sockfd, "exit", 4, MSG_NOSIGNAL);
+        close(sockfd);
+    }
+}
+
+void fm_pool_discard(FmPool* pool, int sockfd) {
+    close(sockfd);
+    // the session may be why it failed (expired or evicted on the server), a login costs little
+    pthread_mutex_lock(&pool->lock);
+    pool->session[0] = '\0';
+    pthread_mutex_unlock(&pool->lock);
+}
+
+int fm_pool_request(FmPool* pool, const char* command, char* reply, int size) {
+    // a second attempt only happens after discard, which means a fresh login
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int sockfd = fm_pool_get(pool);
+        if (sockfd == -1) {
+            return -1;
+        }
+        int bytes_received = -1;
+        if (send(sockfd, command, strlen(command), MSG_NOSIGNAL) > 0) {
+            bytes_received = recv(sockfd, reply, size - 1, 0);
+        }
+        if (bytes_received > 0) {
+            reply[bytes_received] = '\0';
+            if (strncmp(reply, "Invalid session", 15) != 0) {
+                fm_pool_put(pool, sockfd);
+                return bytes_received;
+            }
+        }
+        fm_pool_discard(pool, sockfd);
+    }
+    return -1;
+}
+
+void fm_pool_destroy(FmPool* pool) {
+    for (int i = 0; i < pool->idle_count; i++) {
+        send(pool->idle[i], "exit", 4, MSG_NOSIGNAL);
+        close(pool->idle[i]);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
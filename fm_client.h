@@ -0,0 +1,45 @@
+#ifndef FM_CLIENT_H
+#define FM_CLIENT_H
+
+#include <pthread.h>
+#include "session.h"
+
+#define MAX_POOL_CONNECTIONS 16
+
+// open a TCP connection to the server, host is a name or an address. Returns the socket or -1 with errno set
+int fm_connect(const char* host, int port);
+
+// full "username|group" handshake. On success the server's session token is
+// copied to session. Returns 1 on success, 0 if the server rejected the username or group, -1 on disconnect.
+int fm_login(int sockfd, const char* username, const char* group, char* session);
+
+// resume an earlier session. No reply is sent, so commands can follow immediately;
+// an unknown token makes the server answer the first command with "Invalid session".
+int fm_resume(int sockfd, const char* session);
+
+// a set of logged-in connections to one server that scripts can reuse
+typedef struct FmPool {
+    char host[64];
+    int port;
+    char username[20];
+    char group[20];
+    char session[SESSION_TOKEN_SIZE];
+    int idle[MAX_POOL_CONNECTIONS];
+    int idle_count;
+    pthread_mutex_t lock;
+} FmPool;
+
+FmPool* fm_pool_create(const char* host, int port, const char* username, const char* group);
+// an idle connection, or a new one (resumed if the pool already has a session). -1 on failure
+int fm_pool_get(FmPool* pool);
+// hand a connection back after its last reply has been read
+void fm_pool_put(FmPool* pool, int sockfd);
+// close a connection that is broken, in an unknown state or answered "Invalid session".
+// The pool's session is forgotten too, so the next new connection logs in again
+void fm_pool_discard(FmPool* pool, int sockfd);
+// send a command with a single reply (not read/write) on a pooled connection. A session the
+// server has dropped is replaced by a fresh login and the command retried. Returns the reply length or -1
+int fm_pool_request(FmPool* pool, const char* command, char* reply, int size);
+void fm_pool_destroy(FmPool* pool);
+
+#endif
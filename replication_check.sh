@@ -0,0 +1,71 @@
+#!/bin/sh
+# Replication check on localhost: start a primary, a replica and clients, write on
+# the primary, read it back from the replica, then kill the primary and promote the replica.
+# Run from the repository root after make: ./replication_check.sh (BASE_PORT picks the ports)
+set -u
+BASE=${BASE_PORT:-23450}
+PRIMARY_PORT=$BASE
+PRIMARY_REPL_PORT=$((BASE + 1))
+REPLICA_PORT=$((BASE + 10))
+REPLICA_REPL_PORT=$((BASE + 11))
+DIR=$(mktemp -d)
+PRIMARY=
+REPLICA=
+
+cleanup() {
+    kill $PRIMARY $REPLICA 2>/dev/null
+    rm -rf "$DIR"
+}
+trap cleanup EXIT
+
+fail() {
+    echo "FAIL: $1"
+    echo "--- client output:"
+    cat "$DIR/out"
+    exit 1
+}
+
+# client <port> <stdin script>, output goes to $DIR/out
+client() {
+    printf "$2" | ./client 127.0.0.1 "$1" > "$DIR/out" 2>&1
+}
+
+expect() {
+    grep -q "$1" "$DIR/out" || fail "$2"
+}
+
+./server -p $PRIMARY_PORT -r $PRIMARY_REPL_PORT > "$DIR/primary.log" 2>&1 &
+PRIMARY=$!
+./server -p $REPLICA_PORT -r $REPLICA_REPL_PORT -f 127.0.0.1:$PRIMARY_REPL_PORT > "$DIR/replica.log" 2>&1 &
+REPLICA=$!
+sleep 1
+
+client $PRIMARY_PORT 'alice\n1\ncreate notes rwr---\nwrite notes o\nreplicated text\n\nexit\n'
+expect "File created successfully" "create on primary"
+expect "written successfully with 15 bytes" "write on primary"
+sleep 1
+
+client $REPLICA_PORT 'bob\n1\nread notes c\nstats\nexit\n'
+expect "replicated text" "read from replica"
+expect "Checksum verified" "checksum of replicated content"
+expect "Primary: connected" "replica connection state"
+expect "Replication lag: 0 records" "replica caught up"
+
+client $REPLICA_PORT 'alice\n1\ncreate other rw----\nexit\n'
+expect "read-only replica" "replica refuses changes"
+
+kill $PRIMARY
+wait $PRIMARY 2>/dev/null
+PRIMARY=
+sleep 2
+client $REPLICA_PORT 'bob\n1\nstats\nexit\n'
+expect "Primary: disconnected" "replica notices lost primary"
+expect "Replication lag: 0 records, [0-9]\{4,\} ms" "lag grows while the primary is gone"
+
+kill -USR1 $REPLICA
+sleep 2
+client $REPLICA_PORT 'alice\n1\ncreate other rw----\nstats\nexit\n'
+expect "File created successfully" "create on promoted replica"
+expect "Role: primary" "promoted role"
+
+echo "PASS: replication check"
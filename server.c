@@ -1,21 +1,61 @@
 #include <stdio.h>
+#include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <pthread.h>
 #include <time.h>
+#include <signal.h>
+#include <netdb.h>
+#include <sys/time.h>
+#include <sys/random.h>
+#include <netinet/tcp.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <dirent.h>
+#include "checksum.h"
+#include "session.h"
 
 #define PORT 12350
 #define BUFFER_SIZE 512*1024
 #define COMMAND_BUFFER_SIZE 512
 #define MAX_CLIENTS 10
 #define RESPONSE_SIZE 65536
+#define SCRUB_INTERVAL 60 // seconds between background checksum scrubs
+#define EVICT_RETRY_MS 100 // evictor wait when every resident file is busy
+#define SPILL_RETRY_MS 1000 // evictor wait after a spill file could not be written
+#define SPILL_REPORT_INTERVAL 10 // seconds between repeated spill failure messages
+#define MAX_REPLICAS 8
+#define HEARTBEAT_INTERVAL 1 // seconds between replication heartbeats
+#define RECORD_HEADER_SIZE 256
+#define REPLICA_QUEUE_BYTES (64L * 1024 * 1024) // live records a replica may fall behind by before it is dropped, not counted in -m
+#define REPLICA_SEND_TIMEOUT 30 // seconds a send to a replica may block
+#define MAX_SESSIONS 256
+#define SESSION_TTL 3600 // seconds an unused session stays resumable
+#define MAX_FILES 100
+#define MIN_CONTENT_CAPACITY 4096
+
+// errors from add_file/append_content
+#define ERR_TABLE_FULL -1
+#define ERR_NO_MEMORY -2
+#define ERR_USER_QUOTA -3
+#define ERR_GROUP_QUOTA -4
 
 const char* GROUPS[] = { "AOS-students", "CSE-students" };
 
 pthread_mutex_t file_system_lock = PTHREAD_MUTEX_INITIALIZER;
 
+// bytes and files charged to one user or group
+typedef struct Usage {
+    char name[20];
+    long bytes;
+    int files;
+} Usage;
+
 typedef struct File {
     char filename[50];
     char owner[20];
@@ -24,14 +64,99 @@ typedef struct File {
     int size;
     char creation_date[20]; 
     char* contentBuffer;    // dynamic allocate content    
+    int capacity;           // bytes allocated for contentBuffer
+    // tiered store: cold content is spilled to disk under the memory limit
+    int resident;           // content is in contentBuffer, else in the spill file
+    int on_disk;            // spill file holds the current content
+    int referenced;         // CLOCK bit, set on every access
+    Usage* owner_usage;
+    Usage* group_usage;
+    // crc32c of each CHECKSUM_BLOCK_SIZE block of content
+    uint32_t* block_checksums;
+    int block_count;
+    int block_capacity;     // entries allocated in block_checksums
     //each file has its mutex lock
     pthread_mutex_t rwmutex; 
     int active_readers;
     int active_writers;
+    // evictor and scrubber reads: writers wait for these instead of being refused
+    int background_readers;
+    int waiting_writers;
+    pthread_cond_t background_done;
 } File;
 
-File file_system[100];
+File file_system[MAX_FILES];
 int file_count = 0;
+
+// quotas, 0 means unlimited. Usage is only changed with file_system_lock held
+long user_quota_bytes = 0;
+int user_quota_files = 0;
+long group_quota_bytes = 0;
+int group_quota_files = 0;
+Usage user_usages[MAX_FILES];
+int user_usage_count = 0;
+Usage group_usages[MAX_FILES];
+int group_usage_count = 0;
+
+long memory_limit = 0;           // resident content bytes before eviction starts, 0 = never evict
+long resident_bytes = 0;
+int clock_hand = 0;
+pthread_cond_t evict_needed = PTHREAD_COND_INITIALIZER;    // resident_bytes went over memory_limit
+const char* spill_dir = "spill";
+char spill_instance_dir[256];    // <spill_dir>/<port>, so servers sharing spill_dir never share files
+
+// sessions let a client reconnect with "@<token>" instead of the username|group handshake
+typedef struct Session {
+    char token[SESSION_TOKEN_SIZE];
+    char username[20];
+    char group[20];
+    time_t last_used;
+    unsigned long use_order;    // LRU order, time() is too coarse to rank sessions made in the same second
+} Session;
+
+pthread_mutex_t session_lock = PTHREAD_MUTEX_INITIALIZER;
+Session sessions[MAX_SESSIONS];
+int session_count = 0;
+unsigned long session_uses = 0;
+
+int verbose = 0;                 // -v: log every connection and command
+int max_clients = MAX_CLIENTS;
+atomic_int active_clients = 0;
+
+// replication: every create/write/mode is shipped to the connected replicas as a log record
+typedef struct QueuedRecord {
+    struct QueuedRecord* next;
+    int len;
+    int spill_fd;                   // payload still on disk (snapshot of a spilled file), else -1
+    int spill_len;
+    char data[];                    // header line followed by the payload
+} QueuedRecord;
+
+// each replica has its own queue and sender thread, so a slow one never blocks the primary
+typedef struct Replica {
+    int socket;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    QueuedRecord* head;
+    QueuedRecord* tail;
+    long queued_bytes;
+    long queue_limit;               // snapshot size + REPLICA_QUEUE_BYTES
+    int closed;                     // sender should stop, queue is being dropped
+} Replica;
+
+pthread_mutex_t replication_lock = PTHREAD_MUTEX_INITIALIZER;
+Replica* replicas[MAX_REPLICAS];
+int replica_count = 0;
+unsigned long repl_seq = 0;         // sequence number of the last record this server published
+// replica side, follows the primary until promoted with SIGUSR1
+volatile sig_atomic_t is_replica = 0;
+volatile sig_atomic_t promote_requested = 0;
+volatile sig_atomic_t primary_socket = -1;
+unsigned long primary_seq = 0;      // latest sequence number seen from the primary
+unsigned long applied_seq = 0;      // last sequence number applied here
+long long applied_time_ms = 0;      // primary timestamp of the last applied record
+long long last_heard_ms = 0;        // local time of the last record or heartbeat, 0 = never
+int primary_connected = 0;
 //check "AOS-students", "CSE-students" or else
 int is_valid_group(const char* group) {
     for (int i = 0; i < (int)(sizeof(GROUPS) / sizeof(GROUPS[0])); i++) {
@@ -41,11 +166,78 @@ int is_valid_group(const char* group) {
     }
     return 0;
 }
+
+// usernames are fields of newline-delimited replication records, so they must be a single printable word
+int is_valid_username(const char* username) {
+    if (username[0] == '\0') {
+        return 0;
+    }
+    for (const char* c = username; *c; c++) {
+        if (!isgraph((unsigned char)*c)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+// new session for a logged in user, token is written to token. Reuses the least recently used slot when full
+int create_session(const char* username, const char* group, char* token) {
+    unsigned char random_bytes[(SESSION_TOKEN_SIZE - 1) / 2];
+    if (getrandom(random_bytes, sizeof(random_bytes), 0) != sizeof(random_bytes)) {
+        return 0;
+    }
+    for (int i = 0; i < (int)sizeof(random_bytes); i++) {
+        sprintf(token + 2 * i, "%02x", random_bytes[i]);
+    }
+
+    pthread_mutex_lock(&session_lock);
+    int slot = session_count;
+    if (session_count == MAX_SESSIONS) {
+        slot = 0;
+        for (int i = 1; i < session_count; i++) {
+            if (sessions[i].use_order < sessions[slot].use_order) {
+                slot = i;
+            }
+        }
+    }
+    else {
+        session_count++;
+    }
+    strcpy(sessions[slot].token, token);
+    strcpy(sessions[slot].username, username);
+    strcpy(sessions[slot].group, group);
+    sessions[slot].last_used = time(NULL);
+    sessions[slot].use_order = ++session_uses;
+    pthread_mutex_unlock(&session_lock);
+    return 1;
+}
+
+// look up a session token, filling in its username and group
+int resume_session(const char* token, char* username, char* group) {
+    int found = 0;
+    time_t now = time(NULL);
+    pthread_mutex_lock(&session_lock);
+    for (int i = 0; i < session_count; i++) {
+        if (strcmp(sessions[i].token, token) == 0 && now - sessions[i].last_used < SESSION_TTL) {
+            strcpy(username, sessions[i].username);
+            strcpy(group, sessions[i].group);
+            sessions[i].last_used = now;
+            sessions[i].use_order = ++session_uses;
+            found = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&session_lock);
+    return found;
+}
+
 // mutex lock
 void init_file_lock(File* f) {
     pthread_mutex_init(&(f->rwmutex), NULL);
+    pthread_cond_init(&(f->background_done), NULL);
     f->active_readers = 0;
     f->active_writers = 0;
+    f->background_readers = 0;
+    f->waiting_writers = 0;
 }
 
 int try_start_read(File* f) {
@@ -68,6 +260,12 @@ void end_read(File* f) {
 
 int try_start_write(File* f) {
     pthread_mutex_lock(&(f->rwmutex));
+    // background reads are short, wait them out rather than refuse the client
+    while (f->active_writers == 0 && f->active_readers == 0 && f->background_readers > 0) {
+        f->waiting_writers++;
+        pthread_cond_wait(&(f->background_done), &(f->rwmutex));
+        f->waiting_writers--;
+    }
     if (f->active_writers > 0 || f->active_readers > 0) {
         pthread_mutex_unlock(&(f->rwmutex));
         return 0;
@@ -83,32 +281,588 @@ void end_write(File* f) {
     pthread_mutex_unlock(&(f->rwmutex));
 }
 
-void add_file(const char* filename, const char* owner, const char* group, const char* permissions, int size) {
+// read hold for background work. Unlike try_start_read it gives way to a waiting writer
+int try_start_background_read(File* f) {
+    pthread_mutex_lock(&(f->rwmutex));
+    int ok = f->active_writers == 0 && f->waiting_writers == 0;
+    if (ok) {
+        f->background_readers++;
+    }
+    pthread_mutex_unlock(&(f->rwmutex));
+    return ok;
+}
+
+void end_background_read(File* f) {
+    pthread_mutex_lock(&(f->rwmutex));
+    f->background_readers--;
+    if (f->background_readers == 0) {
+        pthread_cond_broadcast(&(f->background_done));
+    }
+    pthread_mutex_unlock(&(f->rwmutex));
+}
+
+// make room for checksums of size bytes of content, call with file_system_lock held
+int reserve_checksums(File* f, int size) {
+    int needed = (size + CHECKSUM_BLOCK_SIZE - 1) / CHECKSUM_BLOCK_SIZE;
+    if (needed > f->block_capacity) {
+        uint32_t* new_checksums = realloc(f->block_checksums, needed * sizeof(uint32_t));
+        if (!new_checksums) {
+            return 0;
+        }
+        f->block_checksums = new_checksums;
+        f->block_capacity = needed;
+    }
+    return 1;
+}
+
+// extend block checksums over content[offset, offset + len), call with file_system_lock held
+// after reserve_checksums for offset + len
+void update_checksums(File* f, int offset, int len) {
+    int needed = (offset + len + CHECKSUM_BLOCK_SIZE - 1) / CHECKSUM_BLOCK_SIZE;
+    if (needed > f->block_count) {
+        // a new block starts from the crc of no data
+        memset(f->block_checksums + f->block_count, 0, (needed - f->block_count) * sizeof(uint32_t));
+        f->block_count = needed;
+    }
+    while (len > 0) {
+        int block = offset / CHECKSUM_BLOCK_SIZE;
+        int chunk = CHECKSUM_BLOCK_SIZE - offset % CHECKSUM_BLOCK_SIZE;
+        if (chunk > len) {
+            chunk = len;
+        }
+        f->block_checksums[block] = crc32c(f->block_checksums[block], f->contentBuffer + offset, chunk);
+        offset += chunk;
+        len -= chunk;
+    }
+}
+
+// return the first block of content that no longer matches its checksum, or -1
+int verify_checksums(const File* f, const char* content) {
+    for (int block = 0; block < f->block_count; block++) {
+        int offset = block * CHECKSUM_BLOCK_SIZE;
+        int len = f->size - offset;
+        if (len > CHECKSUM_BLOCK_SIZE) {
+            len = CHECKSUM_BLOCK_SIZE;
+        }
+        if (crc32c(0, content + offset, len) != f->block_checksums[block]) {
+            return block;
+        }
+    }
+    return -1;
+}
+
+long long now_ms() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+int send_all(int sock, const char* data, int len) {
+    while (len > 0) {
+        int sent = send(sock, data, len, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return 0;
+        }
+        data += sent;
+        len -= sent;
+    }
+    return 1;
+}
+
+// record = "<type> <seq> <timestamp ms> <fields>\n" followed by payload_len bytes
+QueuedRecord* make_record(char type, unsigned long seq, const char* fields, const char* payload, int payload_len) {
+    char header[RECORD_HEADER_SIZE];
+    int header_len = snprintf(header, sizeof(header), "%c %lu %lld %s\n", type, seq, now_ms(), fields);
+    QueuedRecord* record = malloc(sizeof(QueuedRecord) + header_len + payload_len);
+    if (!record) {
+        return NULL;
+    }
+    record->next = NULL;
+    record->len = header_len + payload_len;
+    record->spill_fd = -1;
+    record->spill_len = 0;
+    memcpy(record->data, header, header_len);
+    if (payload_len > 0) {
+        memcpy(record->data + header_len, payload, payload_len);
+    }
+    return record;
+}
+
+// record whose payload is read from an open spill file when it is sent, so snapshots of
+// spilled files don't take memory. Takes ownership of spill_fd
+QueuedRecord* make_spill_record(char type, unsigned long seq, const char* fields, int spill_fd, int spill_len) {
+    QueuedRecord* record = make_record(type, seq, fields, NULL, 0);
+    if (!record) {
+        close(spill_fd);
+        return NULL;
+    }
+    record->spill_fd = spill_fd;
+    record->spill_len = spill_len;
+    return record;
+}
+
+void free_record(QueuedRecord* record) {
+    if (record && record->spill_fd >= 0) {
+        close(record->spill_fd);
+    }
+    free(record);
+}
+
+// stop a replica's sender, it drops whatever is still queued
+void close_replica(Replica* r) {
+    r->closed = 1;
+    shutdown(r->socket, SHUT_RDWR);
+    pthread_cond_signal(&r->ready);
+}
+
+// queue a record for a replica, taking ownership of it. A replica whose live backlog
+// would pass its queue limit is dropped; it resyncs from a snapshot when it reconnects
+void enqueue_record(Replica* r, QueuedRecord* record, int enforce_limit) {
+    pthread_mutex_lock(&r->lock);
+    if (record == NULL || (enforce_limit && r->queued_bytes + record->len > r->queue_limit)) {
+        if (!r->closed) {
+            printf("Replica fell too far behind, dropping it.\n");
+            close_replica(r);
+        }
+    }
+    if (r->closed || record == NULL) {
+        pthread_mutex_unlock(&r->lock);
+        free_record(record);
+        return;
+    }
+    if (r->tail) {
+        r->tail->next = record;
+    }
+    else {
+        r->head = record;
+    }
+    r->tail = record;
+    r->queued_bytes += record->len;
+    pthread_cond_signal(&r->ready);
+    pthread_mutex_unlock(&r->lock);
+}
+
+// hand a record to every replica's queue. Mutations call this with file_system_lock held so
+// replicas see records in the same order the changes were made; only the copy happens under the lock
+void publish_record(char type, const char* fields, const char* payload, int payload_len) {
+    pthread_mutex_lock(&replication_lock);
+    if (type != 'H') {
+        repl_seq++;
+    }
+    for (int i = 0; i < replica_count; i++) {
+        enqueue_record(replicas[i], make_record(type, repl_seq, fields, payload, payload_len), 1);
+    }
+    pthread_mutex_unlock(&replication_lock);
+}
+
+void format_replication_stats(char* out, int size) {
+    pthread_mutex_lock(&replication_lock);
+    int len = snprintf(out, size, "Role: %s\nLast published sequence: %lu\nReplicas connected: %d\n",
+        is_replica ? "replica" : "primary", repl_seq, replica_count);
+    if (is_replica && last_heard_ms == 0) {
+        snprintf(out + len, size - len, "Primary: %s, never heard from\n", primary_connected ? "connected" : "disconnected");
+    }
+    else if (is_replica) {
+        // caught up means as fresh as the last thing the primary said, so a silent or lost primary shows growing lag
+        unsigned long lag_records = primary_seq > applied_seq ? primary_seq - applied_seq : 0;
+        long long now = now_ms();
+        long long lag_ms = lag_records > 0 ? now - applied_time_ms : now - last_heard_ms;
+        snprintf(out + len, size - len, "Primary: %s, last heard %lld ms ago\nApplied sequence: %lu of %lu\nReplication lag: %lu records, %lld ms\n",
+            primary_connected ? "connected" : "disconnected", now - last_heard_ms, applied_seq, primary_seq, lag_records, lag_ms);
+    }
+    pthread_mutex_unlock(&replication_lock);
+}
+
+const char* store_error(int err) {
+    switch (err) {
+    case ERR_TABLE_FULL:
+        return "File table is full.";
+    case ERR_USER_QUOTA:
+        return "Quota exceeded for the file owner.";
+    case ERR_GROUP_QUOTA:
+        return "Quota exceeded for the file group.";
+    default:
+        return "Server is out of memory.";
+    }
+}
+
+// usage entry for name, added if missing. Entries nothing is charged to any more are reused
+Usage* find_usage(Usage* table, int* count, const char* name) {
+    Usage* unused = NULL;
+    for (int i = 0; i < *count; i++) {
+        if (strcmp(table[i].name, name) == 0) {
+            return &table[i];
+        }
+        if (unused == NULL && table[i].files == 0) {
+            unused = &table[i];
+        }
+    }
+    if (unused == NULL) {
+        if (*count == MAX_FILES) {
+            return NULL;
+        }
+        unused = &table[(*count)++];
+    }
+    snprintf(unused->name, sizeof(unused->name), "%s", name);
+    unused->bytes = 0;
+    unused->files = 0;
+    return unused;
+}
+
+// 1 if owner and group can take bytes and files more, else the quota error
+int check_quota(const Usage* owner, const Usage* group, long bytes, int files) {
+    if ((user_quota_bytes > 0 && owner->bytes + bytes > user_quota_bytes) ||
+        (user_quota_files > 0 && owner->files + files > user_quota_files)) {
+        return ERR_USER_QUOTA;
+    }
+    if ((group_quota_bytes > 0 && group->bytes + bytes > group_quota_bytes) ||
+        (group_quota_files > 0 && group->files + files > group_quota_files)) {
+        return ERR_GROUP_QUOTA;
+    }
+    return 1;
+}
+
+void spill_path(const File* f, char* path, int size) {
+    snprintf(path, size, "%s/%d.spill", spill_instance_dir, (int)(f - file_system));
+}
+
+// open a file's spill file for reading, -1 on failure
+int open_spill(const File* f) {
+    char path[256];
+    spill_path(f, path, sizeof(path));
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        perror("Failed to open spill file");
+    }
+    return fd;
+}
+
+// read spilled content into a new buffer with room for '\0', NULL on failure
+char* load_spill(const File* f) {
+    char path[256];
+    spill_path(f, path, sizeof(path));
+    char* buffer = malloc(f->size + 1);
+    if (!buffer) {
+        return NULL;
+    }
+    FILE* spill = fopen(path, "rb");
+    if (!spill || (int)fread(buffer, 1, f->size, spill) != f->size) {
+        perror("Failed to read spill file");
+        if (spill) {
+            fclose(spill);
+        }
+        free(buffer);
+        return NULL;
+    }
+    fclose(spill);
+    buffer[f->size] = '\0';
+    return buffer;
+}
+
+// write a file's content to its spill file. Called without file_system_lock, the
+// caller's read hold keeps the content from changing meanwhile. 0 with errno set on failure.
+// The new file is renamed into place, so a replica snapshot still reading the old one keeps it intact
+int write_spill(const File* f) {
+    char path[256], temp_path[300];
+    spill_path(f, path, sizeof(path));
+    snprintf(temp_path, sizeof(temp_path), "%s.XXXXXX", path);
+    int fd = mkstemp(temp_path);
+    if (fd == -1) {
+        return 0;
+    }
+    FILE* spill = fdopen(fd, "wb");
+    if (!spill) {
+        int open_errno = errno;
+        close(fd);
+        unlink(temp_path);
+        errno = open_errno;
+        return 0;
+    }
+    int ok = (int)fwrite(f->contentBuffer, 1, f->size, spill) == f->size;
+    ok = fclose(spill) == 0 && ok;
+    ok = ok && rename(temp_path, path) == 0;
+    if (!ok) {
+        int spill_errno = errno;
+        unlink(temp_path);
+        errno = spill_errno;
+    }
+    return ok;
+}
+
+// wait on evict_needed for at most ms, call with file_system_lock held
+void wait_evict_needed(int ms) {
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += ms / 1000;
+    until.tv_nsec += (ms % 1000) * 1000000L;
+    if (until.tv_nsec >= 1000000000) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&evict_needed, &file_system_lock, &until);
+}
+
+// CLOCK sweep for an idle file that wasn't used since the last pass. The victim is returned
+// with a background read hold so writers wait while it is spilled. Call with file_system_lock held
+File* pick_victim() {
+    // two passes clear every reference bit, so give up after that
+    for (int steps = 0; steps < 2 * file_count; steps++) {
+        File* f = &file_system[clock_hand];
+        clock_hand = (clock_hand + 1) % file_count;
+        if (!f->resident || f->capacity == 0) {
+            continue;
+        }
+        if (f->referenced) {
+            f->referenced = 0;
+            continue;
+        }
+        // readers and writers use contentBuffer without file_system_lock
+        pthread_mutex_lock(&(f->rwmutex));
+        int idle = f->active_readers == 0 && f->active_writers == 0 &&
+            f->background_readers == 0 && f->waiting_writers == 0;
+        if (idle) {
+            f->background_readers++;
+        }
+        pthread_mutex_unlock(&(f->rwmutex));
+        if (idle) {
+            return f;
+        }
+    }
+    return NULL;
+}
+
+// spill idle files while resident content is over the memory limit. Disk writes happen
+// without file_system_lock, only picking the victim and dropping its buffer take it
+void* evict_files(void* arg) {
+    long long last_report = 0;
+    int failures = 0;           // spill failures since the last message
     pthread_mutex_lock(&file_system_lock);
-    // initialize
-    strncpy(file_system[file_count].filename, filename, sizeof(file_system[file_count].filename));
-    strncpy(file_system[file_count].owner, owner, sizeof(file_system[file_count].owner));
-    strncpy(file_system[file_count].group, group, sizeof(file_system[file_count].group));
-    strncpy(file_system[file_count].permissions, permissions, sizeof(file_system[file_count].permissions));
-    file_system[file_count].size = 0;
-
-    // allocate space to content buffer
-    file_system[file_count].contentBuffer = (char*)malloc(size);
-    if (file_system[file_count].contentBuffer == NULL) {
-        perror("Failed to allocate memory for contentBuffer");
+    while (1) {
+        if (resident_bytes <= memory_limit) {
+            pthread_cond_wait(&evict_needed, &file_system_lock);
+            continue;
+        }
+        File* f = pick_victim();
+        if (f == NULL) {
+            // everything resident is busy or was just used, look again shortly
+            wait_evict_needed(EVICT_RETRY_MS);
+            continue;
+        }
+        int written = f->on_disk;
         pthread_mutex_unlock(&file_system_lock);
-        exit(EXIT_FAILURE);
+        if (!written) {
+            written = write_spill(f);
+        }
+        int spill_errno = errno;
+        pthread_mutex_lock(&file_system_lock);
+        if (written) {
+            f->on_disk = 1;
+            // a reader that arrived during the write keeps the buffer, the next pass frees it
+            pthread_mutex_lock(&(f->rwmutex));
+            int alone = f->active_readers == 0 && f->background_readers == 1;
+            pthread_mutex_unlock(&(f->rwmutex));
+            if (alone) {
+                free(f->contentBuffer);
+                f->contentBuffer = NULL;
+                resident_bytes -= f->capacity;
+                f->capacity = 0;
+                f->resident = 0;
+            }
+        }
+        end_background_read(f);
+        if (!written) {
+            // full or missing disk: the file stays resident, report now and then and back off
+            failures++;
+            if (now_ms() - last_report >= SPILL_REPORT_INTERVAL * 1000) {
+                fprintf(stderr, "Failed to write spill file for %s: %s (%d failure(s) since last report)\n",
+                    f->filename, strerror(spill_errno), failures);
+                last_report = now_ms();
+                failures = 0;
+            }
+            wait_evict_needed(SPILL_RETRY_MS);
+        }
+    }
+    return NULL;
+}
+
+// make sure a file's content is in memory. Call with a read or write hold on f and without
+// file_system_lock, the spill file is read unlocked
+int ensure_resident(File* f) {
+    pthread_mutex_lock(&file_system_lock);
+    f->referenced = 1;
+    int resident = f->resident;
+    pthread_mutex_unlock(&file_system_lock);
+    if (resident) {
+        return 1;
+    }
+    char* buffer = load_spill(f);
+    if (!buffer) {
+        return 0;
+    }
+    pthread_mutex_lock(&file_system_lock);
+    if (f->resident) {
+        // another reader loaded it first
+        free(buffer);
+    }
+    else {
+        f->contentBuffer = buffer;
+        f->capacity = f->size + 1;
+        f->resident = 1;
+        resident_bytes += f->capacity;
+        if (memory_limit > 0 && resident_bytes > memory_limit) {
+            pthread_cond_signal(&evict_needed);
+        }
+    }
+    pthread_mutex_unlock(&file_system_lock);
+    return 1;
+}
+
+// returns the new file's index or an ERR_ code, enforce_quota is off for replicated creates
+int add_file(const char* filename, const char* owner, const char* group, const char* permissions, int enforce_quota) {
+    pthread_mutex_lock(&file_system_lock);
+    if (file_count == MAX_FILES) {
+        pthread_mutex_unlock(&file_system_lock);
+        return ERR_TABLE_FULL;
+    }
+    Usage* owner_usage = find_usage(user_usages, &user_usage_count, owner);
+    Usage* group_usage = find_usage(group_usages, &group_usage_count, group);
+    if (owner_usage == NULL || group_usage == NULL) {
+        pthread_mutex_unlock(&file_system_lock);
+        return ERR_TABLE_FULL;
     }
-    memset(file_system[file_count].contentBuffer, 0, size);
+    int allowed = enforce_quota ? check_quota(owner_usage, group_usage, 0, 1) : 1;
+    if (allowed != 1) {
+        pthread_mutex_unlock(&file_system_lock);
+        return allowed;
+    }
+    File* f = &file_system[file_count];
+    // initialize
+    memset(f, 0, sizeof(File));
+    strncpy(f->filename, filename, sizeof(f->filename) - 1);
+    strncpy(f->owner, owner, sizeof(f->owner) - 1);
+    strncpy(f->group, group, sizeof(f->group) - 1);
+    strncpy(f->permissions, permissions, sizeof(f->permissions) - 1);
+    // content is allocated on first write
+    f->resident = 1;
+    f->owner_usage = owner_usage;
+    f->group_usage = group_usage;
+    owner_usage->files++;
+    group_usage->files++;
 
     // for capability list date
     time_t t = time(NULL);
     struct tm* tm_info = localtime(&t);
-    strftime(file_system[file_count].creation_date, sizeof(file_system[file_count].creation_date), "%b %d %Y", tm_info);
+    strftime(f->creation_date, sizeof(f->creation_date), "%b %d %Y", tm_info);
+
+    init_file_lock(f);
+
+    char fields[RECORD_HEADER_SIZE];
+    snprintf(fields, sizeof(fields), "%s %s %s %s", filename, group, permissions, owner);
+    publish_record('C', fields, NULL, 0);
+
+    int file_index = file_count++;
+    pthread_mutex_unlock(&file_system_lock);
+    return file_index;
+}
+
+// index of the file with this name, or -1
+int find_file(const char* filename) {
+    int file_index = -1;
+    pthread_mutex_lock(&file_system_lock);
+    for (int i = 0; i < file_count; i++) {
+        if (strcmp(file_system[i].filename, filename) == 0) {
+            file_index = i;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&file_system_lock);
+    return file_index;
+}
+
+void set_permissions(File* f, const char* permissions) {
+    pthread_mutex_lock(&file_system_lock);
+    strncpy(f->permissions, permissions, 6);
+    f->permissions[6] = '\0';
+
+    char fields[RECORD_HEADER_SIZE];
+    snprintf(fields, sizeof(fields), "%s %s", f->filename, f->permissions);
+    publish_record('M', fields, NULL, 0);
+    pthread_mutex_unlock(&file_system_lock);
+}
+
+// append a chunk of content (overwriting first if truncate is set), call with file_system_lock held.
+// Returns 1 or an ERR_ code, enforce_quota is off for replicated writes
+int append_content(File* f, const char* data, int bytes, int truncate, int enforce_quota) {
+    int old_size = f->size;
+    int base_size = truncate ? 0 : f->size;
+    if (enforce_quota) {
+        int allowed = check_quota(f->owner_usage, f->group_usage, base_size + bytes - old_size, 0);
+        if (allowed != 1) {
+            return allowed;
+        }
+    }
+    // appends need ensure_resident first, the old content is not needed when truncating
+    if (!truncate && !f->resident) {
+        return ERR_NO_MEMORY;
+    }
+
+    // allocate everything first, so a failure leaves the old content, size and usage alone
+    int required_size = base_size + bytes;
+    if (!reserve_checksums(f, required_size)) {
+        return ERR_NO_MEMORY;
+    }
+    if (required_size >= f->capacity) {
+        // grow by doubling, keep room for '\0'
+        int new_capacity = f->capacity > 0 ? f->capacity : MIN_CONTENT_CAPACITY;
+        while (new_capacity <= required_size) {
+            new_capacity *= 2;
+        }
+        // a spilled file has no buffer, realloc(NULL) allocates a fresh one
+        char* new_buffer = realloc(f->contentBuffer, new_capacity);
+        if (!new_buffer) {
+            return ERR_NO_MEMORY;
+        }
+        resident_bytes += new_capacity - f->capacity;
+        f->contentBuffer = new_buffer;
+        f->capacity = new_capacity;
+        if (memory_limit > 0 && resident_bytes > memory_limit) {
+            pthread_cond_signal(&evict_needed);
+        }
+    }
+
+    // nothing can fail from here on
+    if (truncate) {
+        f->size = 0;
+        f->block_count = 0;
+        f->resident = 1;
+    }
+    f->referenced = 1;
+    f->on_disk = 0;
+    memcpy(f->contentBuffer + f->size, data, bytes);
+    f->contentBuffer[required_size] = '\0';
+    update_checksums(f, f->size, bytes);
+    f->size = required_size;
+    f->owner_usage->bytes += f->size - old_size;
+    f->group_usage->bytes += f->size - old_size;
 
-    init_file_lock(&file_system[file_count]);
+    char fields[RECORD_HEADER_SIZE];
+    snprintf(fields, sizeof(fields), "%s %s %d", f->filename, truncate ? "o" : "a", bytes);
+    publish_record('W', fields, data, bytes);
+    return 1;
+}
 
-    file_count++;
+void format_storage_stats(char* out, int size) {
+    int spilled = 0;
+    pthread_mutex_lock(&file_system_lock);
+    for (int i = 0; i < file_count; i++) {
+        spilled += !file_system[i].resident;
+    }
+    if (memory_limit > 0) {
+        snprintf(out, size, "Resident content: %ld of %ld bytes, %d file(s) spilled to disk\n", resident_bytes, memory_limit, spilled);
+    }
+    else {
+        snprintf(out, size, "Resident content: %ld bytes, no memory limit\n", resident_bytes);
+    }
     pthread_mutex_unlock(&file_system_lock);
 }
 
@@ -163,65 +917,111 @@ int has_permission(const File* file, const char* username, const char* group, co
 }
 
 
-void* handle_client(void* arg) {
-    int client_socket = (intptr_t)arg;
+void serve_client(int client_socket) {
     char command_buffer[COMMAND_BUFFER_SIZE];
-    char content_buffer[BUFFER_SIZE];
     char response[RESPONSE_SIZE];
     char username[20], group[20];
-    //receive username+group
+    char session[SESSION_TOKEN_SIZE];
+    int pending = 0; // bytes of a command that arrived together with the handshake
+    //receive username+group, or @token to resume a session
     memset(command_buffer, 0, sizeof(command_buffer));
-    if (recv(client_socket, command_buffer, sizeof(command_buffer), 0) <= 0) {
+    int bytes_read = recv(client_socket, command_buffer, sizeof(command_buffer) - 1, 0);
+    if (bytes_read <= 0) {
         perror("Failed to receive username/group");
-        close(client_socket);
-        return NULL;
+        return;
     }
-    // command_buffer = "username|name";
-    char* token = strtok(command_buffer, "|");
-    if (token != NULL) {
-        strncpy(username, token, sizeof(username));
-        username[sizeof(username) - 1] = '\0';
-        token = strtok(NULL, "|");
-    }
-    if (token != NULL) {
-        strncpy(group, token, sizeof(group));
-        group[sizeof(group) - 1] = '\0';
+    if (command_buffer[0] == '@') {
+        // command_buffer = "@token\n" possibly followed by the first command
+        char* end = strchr(command_buffer, '\n');
+        if (end != NULL) {
+            *end = '\0';
+            pending = bytes_read - (int)(end + 1 - command_buffer);
+        }
+        if (!resume_session(command_buffer + 1, username, group)) {
+            snprintf(response, RESPONSE_SIZE, "Invalid session\n");
+            send(client_socket, response, strlen(response), 0);
+            return;
+        }
+        if (verbose) {
+            printf("Resumed session of '%s' (%s)\n", username, group);
+        }
+        // no reply, the client doesn't wait for one
+        if (pending > 0) {
+            memmove(command_buffer, end + 1, pending);
+            command_buffer[pending] = '\0';
+        }
     }
     else {
-        strcpy(group, "");
-    }
-    printf("Received username: '%s'\n", username);
-    printf("Received group: '%s'\n", group);
+        // command_buffer = "username|name";
+        // strtok_r: handshakes are parsed on many threads at once
+        char* saveptr;
+        char* token = strtok_r(command_buffer, "|", &saveptr);
+        strcpy(username, "");
+        if (token != NULL) {
+            strncpy(username, token, sizeof(username));
+            username[sizeof(username) - 1] = '\0';
+            token = strtok_r(NULL, "|", &saveptr);
+        }
+        if (token != NULL) {
+            strncpy(group, token, sizeof(group));
+            group[sizeof(group) - 1] = '\0';
+        }
+        else {
+            strcpy(group, "");
+        }
+        if (verbose) {
+            printf("Received username: '%s'\n", username);
+            printf("Received group: '%s'\n", group);
+        }
 
-    // check group 
-    memset(response, 0, RESPONSE_SIZE);
-    if (!is_valid_group(group)) {
-        snprintf(response, RESPONSE_SIZE, "Invalid group\n");
-        send(client_socket, response, strlen(response), 0);
-        close(client_socket);
-        return NULL;
-    }
-    else {
-        snprintf(response, RESPONSE_SIZE, "\n");
+        // check username and group
+        memset(response, 0, RESPONSE_SIZE);
+        if (!is_valid_username(username)) {
+            snprintf(response, RESPONSE_SIZE, "Invalid username\n");
+            send(client_socket, response, strlen(response), 0);
+            return;
+        }
+        if (!is_valid_group(group)) {
+            snprintf(response, RESPONSE_SIZE, "Invalid group\n");
+            send(client_socket, response, strlen(response), 0);
+            return;
+        }
+        if (!create_session(username, group, session)) {
+            perror("Failed to create session");
+            return;
+        }
+        snprintf(response, RESPONSE_SIZE, "SESSION %s\n", session);
         send(client_socket, response, strlen(response), 0);
     }
 
     while (1) {
         memset(response, 0, RESPONSE_SIZE);
-        memset(command_buffer, 0, COMMAND_BUFFER_SIZE);
-        memset(content_buffer, 0, BUFFER_SIZE);
-
-        int bytes_read = recv(client_socket, command_buffer, sizeof(command_buffer), 0);
-        if (bytes_read <= 0) {
-            printf("Client disconnected: %s\n", username);
-            break;
+        if (pending > 0) {
+            pending = 0;
+        }
+        else {
+            memset(command_buffer, 0, COMMAND_BUFFER_SIZE);
+            bytes_read = recv(client_socket, command_buffer, sizeof(command_buffer) - 1, 0);
+            if (bytes_read <= 0) {
+                if (verbose) {
+                    printf("Client disconnected: %s\n", username);
+                }
+                break;
+            }
+            command_buffer[bytes_read] = '\0';
+        }
+        if (verbose) {
+            printf("Received raw command: '%s'\n", command_buffer);
         }
-        command_buffer[bytes_read] = '\0';
-        printf("Received raw command: '%s'\n", command_buffer);
         //analyze command
         char command[10] = { 0 }, filename[50] = { 0 }, permissions[7] = { 0 }, mode[2] = { 0 };
         int matched = sscanf(command_buffer, "%s %s %s", command, filename, permissions);
 
+        if (is_replica && (strcmp(command, "create") == 0 || strcmp(command, "mode") == 0 || strcmp(command, "write") == 0)) {
+            snprintf(response, RESPONSE_SIZE, "This server is a read-only replica. Send %s to the primary.\n", command);
+            send(client_socket, response, strlen(response), 0);
+            continue;
+        }
         if (strcmp(command, "create") == 0) {
             // create <filename> <permission>
             if (matched != 3 || strlen(filename) == 0 || strlen(permissions) != 6 || strspn(permissions, "rw-") != 6) {
@@ -230,23 +1030,18 @@ void* handle_client(void* arg) {
                 continue;
             }
             // check if file is exist
-            int file_exists = 0;
-            pthread_mutex_lock(&file_system_lock);
-            for (int i = 0; i < file_count; i++) {
-                if (strcmp(file_system[i].filename, filename) == 0) {
-                    file_exists = 1;
-                    break;
-                }
-            }
-            pthread_mutex_unlock(&file_system_lock);
-
-            if (file_exists) {
+            if (find_file(filename) >= 0) {
                 snprintf(response, RESPONSE_SIZE, "File %s already exists.\n", filename);
                 send(client_socket, response, strlen(response), 0);
                 continue;
             }
-            add_file(filename, username, group, permissions, BUFFER_SIZE);
-            snprintf(response, RESPONSE_SIZE, "File created successfully.\n");
+            int created = add_file(filename, username, group, permissions, 1);
+            if (created < 0) {
+                snprintf(response, RESPONSE_SIZE, "Cannot create file %s: %s\n", filename, store_error(created));
+            }
+            else {
+                snprintf(response, RESPONSE_SIZE, "File created successfully.\n");
+            }
             send(client_socket, response, strlen(response), 0);
         }
         else if (strcmp(command, "mode") == 0) {
@@ -257,19 +1052,8 @@ void* handle_client(void* arg) {
                 continue;
             }
             //find the file
-            int file_found = 0;
-            int file_index = -1;
-            pthread_mutex_lock(&file_system_lock);
-            for (int i = 0; i < file_count; i++) {
-                if (strcmp(file_system[i].filename, filename) == 0) {
-                    file_found = 1;
-                    file_index = i;
-                    break;
-                }
-            }
-            pthread_mutex_unlock(&file_system_lock);
-
-            if (!file_found) {
+            int file_index = find_file(filename);
+            if (file_index < 0) {
                 snprintf(response, RESPONSE_SIZE, "file not exist\n");
                 send(client_socket, response, strlen(response), 0);
                 continue;
@@ -281,10 +1065,7 @@ void* handle_client(void* arg) {
                 continue;
             }
 
-            pthread_mutex_lock(&file_system_lock);
-            strncpy(file_system[file_index].permissions, permissions, 6);
-            file_system[file_index].permissions[6] = '\0';
-            pthread_mutex_unlock(&file_system_lock);
+            set_permissions(&file_system[file_index], permissions);
 
             snprintf(response, RESPONSE_SIZE, "Permissions of file %s updated successfully.\n", filename);
             send(client_socket, response, strlen(response), 0);
@@ -297,19 +1078,8 @@ void* handle_client(void* arg) {
                 send(client_socket, response, strlen(response), 0);
                 continue;
             }
-            int file_found = 0;
-            int file_index = -1;
-            pthread_mutex_lock(&file_system_lock);
-            for (int i = 0; i < file_count; i++) {
-                if (strcmp(file_system[i].filename, filename) == 0) {
-                    file_found = 1;
-                    file_index = i;
-                    break;
-                }
-            }
-            pthread_mutex_unlock(&file_system_lock);
-
-            if (!file_found) {
+            int file_index = find_file(filename);
+            if (file_index < 0) {
                 snprintf(response, RESPONSE_SIZE, "File %s not found.\n", filename);
                 send(client_socket, response, strlen(response), 0);
                 continue;
@@ -329,12 +1099,20 @@ void* handle_client(void* arg) {
                 end_write(target_file);
                 continue;
             }
+            // appending to spilled content brings it back from disk first
+            if (strcmp(mode, "a") == 0 && !ensure_resident(target_file)) {
+                snprintf(response, RESPONSE_SIZE, "Cannot write file %s: %s\n", filename, store_error(ERR_NO_MEMORY));
+                send(client_socket, response, strlen(response), 0);
+                end_write(target_file);
+                continue;
+            }
 
             snprintf(response, RESPONSE_SIZE, "Enter your content. End with an empty line:\n");
             send(client_socket, response, strlen(response), 0);
 
             //start to receive content
             int received = 0;
+            int write_error = 0;
             // receive lines of content from server
             char temp_buffer[BUFFER_SIZE / 2];
             while (1) {
@@ -342,7 +1120,6 @@ void* handle_client(void* arg) {
                 int bytes = recv(client_socket, temp_buffer, sizeof(temp_buffer) - 1, 0);
                 if (bytes <= 0) {
                     printf("Client disconnected during write: %s\n", username);
-                    end_write(target_file);
                     break;
                 }
                 temp_buffer[bytes] = '\0';
@@ -351,56 +1128,39 @@ void* handle_client(void* arg) {
                 if (strcmp(temp_buffer, "\n") == 0 || strcmp(temp_buffer, "\r\n") == 0) {
                     break;
                 }
+                // after an error keep reading to the empty line so content isn't taken as commands
+                if (write_error < 0) {
+                    continue;
+                }
                 
                 pthread_mutex_lock(&file_system_lock);
-                int required_size = target_file->size + bytes;
-                if (required_size > BUFFER_SIZE) {
-                    //if content size is larger than space
-                    char* new_buffer = realloc(target_file->contentBuffer, required_size);
-                    if (!new_buffer) {
-                        snprintf(response, RESPONSE_SIZE, "Failed to allocate memory for content.\n");
-                        send(client_socket, response, strlen(response), 0);
-                        pthread_mutex_unlock(&file_system_lock);
-                        end_write(target_file);
-                        break;
-                    }
-                    target_file->contentBuffer = new_buffer;
-                }
-                if (strcmp(mode, "o") == 0 && received == 0) {      
-                    memset(target_file->contentBuffer, 0, target_file->size);
-                    target_file->size = 0;
-                }
-                strncat(target_file->contentBuffer, temp_buffer, bytes);
-                target_file->size += bytes;
+                write_error = append_content(target_file, temp_buffer, bytes, strcmp(mode, "o") == 0 && received == 0, 1);
                 pthread_mutex_unlock(&file_system_lock);
-                received += bytes;
+                if (write_error == 1) {
+                    received += bytes;
+                }
             }
 
-            snprintf(response, RESPONSE_SIZE, "File %s written successfully with %d bytes.\n", filename, received);
+            if (write_error < 0) {
+                snprintf(response, RESPONSE_SIZE, "Write to file %s stopped after %d bytes: %s\n", filename, received, store_error(write_error));
+            }
+            else {
+                snprintf(response, RESPONSE_SIZE, "File %s written successfully with %d bytes.\n", filename, received);
+            }
             send(client_socket, response, strlen(response), 0);
             end_write(target_file);
         }
         else if (strcmp(command, "read") == 0) {
-            int readFormat = sscanf(command_buffer, "%s %s", command, filename);
-            //read <filename>
-            if (readFormat != 2 || strlen(filename) == 0) {
-                snprintf(response, RESPONSE_SIZE, "Invalid command. Usage: read <filename>.\nEND_OF_FILE");
+            char verify[2] = { 0 };
+            int readFormat = sscanf(command_buffer, "%s %s %1s", command, filename, verify);
+            //read <filename> [c]
+            if (readFormat < 2 || strlen(filename) == 0 || (readFormat == 3 && strcmp(verify, "c") != 0)) {
+                snprintf(response, RESPONSE_SIZE, "Invalid command. Usage: read <filename> [c].\nEND_OF_FILE");
                 send(client_socket, response, strlen(response), 0);
                 continue;
             }
-            int file_found = 0;
-            int file_index = -1;
-            pthread_mutex_lock(&file_system_lock);
-            for (int i = 0; i < file_count; i++) {
-                if (strcmp(file_system[i].filename, filename) == 0) {
-                    file_found = 1;
-                    file_index = i;
-                    break;
-                }
-            }
-            pthread_mutex_unlock(&file_system_lock);
-
-            if (!file_found) {
+            int file_index = find_file(filename);
+            if (file_index < 0) {
                 snprintf(response, RESPONSE_SIZE, "File %s not found.\nEND_OF_FILE", filename);
                 send(client_socket, response, strlen(response), 0);
                 continue;
@@ -419,11 +1179,29 @@ void* handle_client(void* arg) {
                 end_read(target_file);
                 continue;
             }
-            if (target_file->size == 0) {               
+            // spilled content comes back from disk first
+            if (!ensure_resident(target_file)) {
+                snprintf(response, RESPONSE_SIZE, "Cannot read file %s: %s\nEND_OF_FILE", filename, store_error(ERR_NO_MEMORY));
+                send(client_socket, response, strlen(response), 0);
+                end_read(target_file);
+                continue;
+            }
+            int bad_block = verify_checksums(target_file, target_file->contentBuffer);
+            if (bad_block >= 0) {
+                printf("Checksum mismatch in file %s block %d\n", filename, bad_block);
+                snprintf(response, RESPONSE_SIZE, "File %s failed integrity check at block %d.\nEND_OF_FILE", filename, bad_block);
+            }
+            else if (target_file->size == 0) {               
                 snprintf(response, RESPONSE_SIZE, "File %s is empty.\nEND_OF_FILE", filename);
             }
             else {   
                 sleep(2); // simulate reading delay
+
+                if (readFormat == 3) {
+                    // checksum of the whole content so the client can verify end to end
+                    snprintf(response, RESPONSE_SIZE, "CRC32C %08x\n", crc32c(0, target_file->contentBuffer, target_file->size));
+                    send(client_socket, response, strlen(response), 0);
+                }
              
                 int bytes_sent = 0;
                 while (bytes_sent < target_file->size) {
@@ -443,8 +1221,16 @@ void* handle_client(void* arg) {
             send(client_socket, response, strlen(response), 0);
             end_read(target_file);
         }
+        else if (strcmp(command, "stats") == 0) {
+            format_replication_stats(response, RESPONSE_SIZE);
+            int len = strlen(response);
+            format_storage_stats(response + len, RESPONSE_SIZE - len);
+            send(client_socket, response, strlen(response), 0);
+        }
         else if (strcmp(command, "exit") == 0) {
-            printf("Client exited: %s\n", username);
+            if (verbose) {
+                printf("Client exited: %s\n", username);
+            }
             send(client_socket, response, strlen(response), 0);
             break;
         }
@@ -452,74 +1238,704 @@ void* handle_client(void* arg) {
             snprintf(response, RESPONSE_SIZE, "Invalid command.\n");
             send(client_socket, response, strlen(response), 0);
         }
-        print_capability_list();
+        // takes file_system_lock and prints every file, so only when asked for
+        if (verbose) {
+            print_capability_list();
+        }
     }
+}
+
+void* handle_client(void* arg) {
+    int client_socket = (intptr_t)arg;
+    serve_client(client_socket);
     close(client_socket);
+    atomic_fetch_sub(&active_clients, 1);
     return NULL;
 }
 
-void cleanup_file_system() {
-    pthread_mutex_lock(&file_system_lock);
-    for (int i = 0; i < file_count; i++) {
-        if (file_system[i].contentBuffer) {
-            free(file_system[i].contentBuffer);
-            file_system[i].contentBuffer = NULL;
+// periodically re-check stored content against its block checksums
+void* scrub_files(void* arg) {
+    while (1) {
+        sleep(SCRUB_INTERVAL);
+        pthread_mutex_lock(&file_system_lock);
+        int count = file_count;
+        pthread_mutex_unlock(&file_system_lock);
+
+        for (int i = 0; i < count; i++) {
+            File* f = &file_system[i];
+            // skip files that are being written, next pass will get them
+            if (!try_start_background_read(f)) {
+                continue;
+            }
+            // spilled files are checked on disk, the spill file can't change while we read it
+            pthread_mutex_lock(&file_system_lock);
+            int resident = f->resident;
+            pthread_mutex_unlock(&file_system_lock);
+            char* content = resident ? f->contentBuffer : load_spill(f);
+            if (content == NULL) {
+                printf("Scrub: cannot read spilled file %s\n", f->filename);
+                end_background_read(f);
+                continue;
+            }
+            int bad_block = verify_checksums(f, content);
+            if (bad_block >= 0) {
+                printf("Scrub: checksum mismatch in file %s block %d\n", f->filename, bad_block);
+            }
+            if (!resident) {
+                free(content);
+            }
+            end_background_read(f);
         }
     }
-    pthread_mutex_unlock(&file_system_lock);
+    return NULL;
 }
 
-int main() {
-    int server_socket, client_socket;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t addr_size = sizeof(client_addr);
-    int active_clients = 0;
+// buffered reader for the replication stream
+typedef struct Reader {
+    int socket;
+    char data[BUFFER_SIZE / 8];
+    int start;
+    int end;
+} Reader;
 
-    server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket == -1) {
-        perror("Socket creation failed");
-        exit(EXIT_FAILURE);
+int reader_fill(Reader* r) {
+    r->start = 0;
+    r->end = recv(r->socket, r->data, sizeof(r->data), 0);
+    return r->end > 0;
+}
+
+// read up to and including '\n', returns 0 on disconnect or overlong line
+int reader_line(Reader* r, char* line, int size) {
+    int len = 0;
+    while (1) {
+        if (r->start == r->end && !reader_fill(r)) {
+            return 0;
+        }
+        char c = r->data[r->start++];
+        if (c == '\n') {
+            line[len] = '\0';
+            return 1;
+        }
+        if (len == size - 1) {
+            return 0;
+        }
+        line[len++] = c;
     }
+}
 
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(PORT);
-    server_addr.sin_addr.s_addr = INADDR_ANY;
+int reader_bytes(Reader* r, char* out, int len) {
+    while (len > 0) {
+        if (r->start == r->end && !reader_fill(r)) {
+            return 0;
+        }
+        int chunk = r->end - r->start;
+        if (chunk > len) {
+            chunk = len;
+        }
+        memcpy(out, r->data + r->start, chunk);
+        r->start += chunk;
+        out += chunk;
+        len -= chunk;
+    }
+    return 1;
+}
 
-    if (bind(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
-        perror("Bind failed");
-        close(server_socket);
+// apply one record from the primary, returns 0 if the stream is broken
+int apply_record(Reader* r, const char* line) {
+    char type;
+    unsigned long seq;
+    long long timestamp;
+    int consumed = 0;
+    if (sscanf(line, "%c %lu %lld %n", &type, &seq, &timestamp, &consumed) != 3 || consumed == 0) {
+        return 0;
+    }
+    const char* fields = line + consumed;
+    char filename[50], owner[20], group[20], permissions[7], mode[2];
+    int bytes;
+
+    if (type == 'C') {
+        if (sscanf(fields, "%49s %19s %6s %19[^\n]", filename, group, permissions, owner) != 4) {
+            return 0;
+        }
+        // on resync the file may already be here
+        int file_index = find_file(filename);
+        if (file_index < 0) {
+            int created = add_file(filename, owner, group, permissions, 0);
+            if (created < 0) {
+                printf("Replication: cannot create %s: %s\n", filename, store_error(created));
+            }
+        }
+        else {
+            set_permissions(&file_system[file_index], permissions);
+        }
+    }
+    else if (type == 'W') {
+        if (sscanf(fields, "%49s %1s %d", filename, mode, &bytes) != 3 || bytes < 0) {
+            return 0;
+        }
+        char* data = malloc(bytes > 0 ? bytes : 1);
+        if (!data) {
+            return 0;
+        }
+        if (!reader_bytes(r, data, bytes)) {
+            free(data);
+            return 0;
+        }
+        int file_index = find_file(filename);
+        if (file_index >= 0) {
+            File* f = &file_system[file_index];
+            // wait for local readers to finish
+            while (!try_start_write(f)) {
+                usleep(1000);
+            }
+            int written = strcmp(mode, "a") == 0 && !ensure_resident(f) ? ERR_NO_MEMORY : 1;
+            pthread_mutex_lock(&file_system_lock);
+            if (written == 1) {
+                written = append_content(f, data, bytes, strcmp(mode, "o") == 0, 0);
+            }
+            if (written < 0) {
+                printf("Replication: cannot write %s: %s\n", filename, store_error(written));
+            }
+            pthread_mutex_unlock(&file_system_lock);
+            end_write(f);
+        }
+        free(data);
+    }
+    else if (type == 'M') {
+        if (sscanf(fields, "%49s %6s", filename, permissions) != 2) {
+            return 0;
+        }
+        int file_index = find_file(filename);
+        if (file_index >= 0) {
+            set_permissions(&file_system[file_index], permissions);
+        }
+    }
+    else if (type != 'H') {
+        return 0;
+    }
+
+    pthread_mutex_lock(&replication_lock);
+    if (seq > primary_seq) {
+        primary_seq = seq;
+    }
+    if (type != 'H') {
+        applied_seq = seq;
+        applied_time_ms = timestamp;
+    }
+    last_heard_ms = now_ms();
+    pthread_mutex_unlock(&replication_lock);
+    return 1;
+}
+
+void promote_to_primary(int sig) {
+    promote_requested = 1;
+    if (primary_socket != -1) {
+        shutdown(primary_socket, SHUT_RDWR);
+    }
+}
+
+// replica: follow the primary's log, reconnecting until promoted
+void* replicate_from_primary(void* arg) {
+    struct sockaddr_in* primary_addr = arg;
+    Reader* reader = malloc(sizeof(Reader));
+    char line[RECORD_HEADER_SIZE];
+    if (!reader) {
+        perror("Failed to allocate replication reader");
         exit(EXIT_FAILURE);
     }
 
-    if (listen(server_socket, MAX_CLIENTS) == -1) {
-        perror("Listen failed");
-        close(server_socket);
+    while (!promote_requested) {
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (sock == -1 || connect(sock, (struct sockaddr*)primary_addr, sizeof(*primary_addr)) == -1) {
+            if (sock != -1) {
+                close(sock);
+            }
+            sleep(1);
+            continue;
+        }
+        printf("Connected to primary, replicating.\n");
+        pthread_mutex_lock(&replication_lock);
+        primary_connected = 1;
+        pthread_mutex_unlock(&replication_lock);
+        primary_socket = sock;
+        // a promotion that raced with connect
+        if (promote_requested) {
+            shutdown(sock, SHUT_RDWR);
+        }
+        reader->socket = sock;
+        reader->start = reader->end = 0;
+        while (reader_line(reader, line, sizeof(line)) && apply_record(reader, line)) {
+        }
+        primary_socket = -1;
+        close(sock);
+        pthread_mutex_lock(&replication_lock);
+        primary_connected = 0;
+        pthread_mutex_unlock(&replication_lock);
+        if (!promote_requested) {
+            printf("Lost connection to primary, retrying.\n");
+            sleep(1);
+        }
+    }
+    is_replica = 0;
+    printf("Promoted to primary.\n");
+    free(reader);
+    return NULL;
+}
+
+// start a detached thread, the server can't run without it
+void start_thread(void* (*fn)(void*), void* arg, const char* name) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, fn, arg) != 0) {
+        fprintf(stderr, "%s thread creation failed\n", name);
         exit(EXIT_FAILURE);
     }
+    pthread_detach(thread);
+}
+
+// stream len bytes of a snapshot's spill file to a replica in bounded pieces
+int send_spill(int sock, int spill_fd, int len) {
+    char chunk[BUFFER_SIZE / 8];
+    while (len > 0) {
+        int bytes = read(spill_fd, chunk, len < (int)sizeof(chunk) ? len : (int)sizeof(chunk));
+        if (bytes <= 0) {
+            perror("Failed to read spill file for replica");
+            return 0;
+        }
+        if (!send_all(sock, chunk, bytes)) {
+            return 0;
+        }
+        len -= bytes;
+    }
+    return 1;
+}
+
+// send one replica's queue in order until it disconnects or is dropped
+void* replica_sender(void* arg) {
+    Replica* r = arg;
+    while (1) {
+        pthread_mutex_lock(&r->lock);
+        while (r->head == NULL && !r->closed) {
+            pthread_cond_wait(&r->ready, &r->lock);
+        }
+        if (r->closed) {
+            pthread_mutex_unlock(&r->lock);
+            break;
+        }
+        QueuedRecord* record = r->head;
+        r->head = record->next;
+        if (r->head == NULL) {
+            r->tail = NULL;
+        }
+        r->queued_bytes -= record->len;
+        pthread_mutex_unlock(&r->lock);
+
+        int ok = send_all(r->socket, record->data, record->len);
+        if (ok && record->spill_fd >= 0) {
+            ok = send_spill(r->socket, record->spill_fd, record->spill_len);
+        }
+        free_record(record);
+        if (!ok) {
+            break;
+        }
+    }
+    printf("Replica disconnected.\n");
+
+    pthread_mutex_lock(&replication_lock);
+    for (int i = 0; i < replica_count; i++) {
+        if (replicas[i] == r) {
+            replicas[i] = replicas[--replica_count];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&replication_lock);
+    // no publisher can reach r any more
+    while (r->head) {
+        QueuedRecord* next = r->head->next;
+        free_record(r->head);
+        r->head = next;
+    }
+    close(r->socket);
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->ready);
+    free(r);
+    return NULL;
+}
+
+// queue every file as it stands for a new replica, then add it to the live stream
+void add_replica(int sock) {
+    struct timeval timeout = { REPLICA_SEND_TIMEOUT, 0 };
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    Replica* r = calloc(1, sizeof(Replica));
+    if (!r) {
+        perror("Failed to allocate replica");
+        close(sock);
+        return;
+    }
+    r->socket = sock;
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->ready, NULL);
+
+    // open spilled files before taking file_system_lock, the sender streams them from disk.
+    // The hold keeps each file from changing or being evicted until its snapshot record is queued
+    int spill_fds[MAX_FILES];
+    int held[MAX_FILES] = { 0 };
+    pthread_mutex_lock(&file_system_lock);
+    int count = file_count;
+    pthread_mutex_unlock(&file_system_lock);
+    for (int i = 0; i < MAX_FILES; i++) {
+        spill_fds[i] = -1;
+    }
+    for (int i = 0; i < count; i++) {
+        File* f = &file_system[i];
+        held[i] = try_start_background_read(f);
+        if (held[i]) {
+            pthread_mutex_lock(&file_system_lock);
+            int resident = f->resident;
+            pthread_mutex_unlock(&file_system_lock);
+            if (!resident && f->size > 0) {
+                spill_fds[i] = open_spill(f);
+            }
+        }
+    }
+
+    pthread_mutex_lock(&file_system_lock);
+    pthread_mutex_lock(&replication_lock);
+    int ok = replica_count < MAX_REPLICAS;
+    char fields[RECORD_HEADER_SIZE];
+    for (int i = 0; ok && i < file_count; i++) {
+        File* f = &file_system[i];
+        snprintf(fields, sizeof(fields), "%s %s %s %s", f->filename, f->group, f->permissions, f->owner);
+        enqueue_record(r, make_record('C', repl_seq, fields, NULL, 0), 0);
+        if (f->size > 0) {
+            snprintf(fields, sizeof(fields), "%s o %d", f->filename, f->size);
+            if (f->resident) {
+                enqueue_record(r, make_record('W', repl_seq, fields, f->contentBuffer, f->size), 0);
+            }
+            else {
+                // spilled content is sent from disk rather than paged in. A file a writer had
+                // when the snapshot started is opened here, that is no more than an open()
+                int spill_fd = held[i] ? spill_fds[i] : open_spill(f);
+                spill_fds[i] = -1;
+                enqueue_record(r, spill_fd >= 0 ? make_spill_record('W', repl_seq, fields, spill_fd, f->size) : NULL, 0);
+            }
+        }
+        ok = !r->closed;
+    }
+    if (ok) {
+        enqueue_record(r, make_record('H', repl_seq, "", NULL, 0), 0);
+        ok = !r->closed;
+    }
+    if (ok) {
+        r->queue_limit = r->queued_bytes + REPLICA_QUEUE_BYTES;
+        replicas[replica_count++] = r;
+        printf("Replica connected, %d file(s) queued.\n", file_count);
+    }
+    pthread_mutex_unlock(&replication_lock);
+    pthread_mutex_unlock(&file_system_lock);
+    for (int i = 0; i < MAX_FILES; i++) {
+        // left over when the snapshot stopped early
+        if (spill_fds[i] >= 0) {
+            close(spill_fds[i]);
+        }
+        if (held[i]) {
+            end_background_read(&file_system[i]);
+        }
+    }
+
+    // on failure the sender just cleans up
+    if (!ok) {
+        r->closed = 1;
+    }
+    start_thread(replica_sender, r, "Replica sender");
+}
 
-    printf("Server is listening on port %d\n", PORT);
+void* accept_replicas(void* arg) {
+    int repl_socket = (intptr_t)arg;
+    while (1) {
+        int sock = accept(repl_socket, NULL, NULL);
+        if (sock == -1) {
+            perror("Replica connection failed");
+            continue;
+        }
+        add_replica(sock);
+    }
+    return NULL;
+}
 
+// heartbeats carry the latest sequence number so replicas can measure lag while idle
+void* send_heartbeats(void* arg) {
     while (1) {
+        sleep(HEARTBEAT_INTERVAL);
+        publish_record('H', "", NULL, 0);
+    }
+    return NULL;
+}
+
+void* accept_clients(void* arg) {
+    int server_socket = (intptr_t)arg;
+    int client_socket;
+    struct sockaddr_in client_addr;
+    socklen_t addr_size;
+    int on = 1;
+
+    while (1) {
+        addr_size = sizeof(client_addr);
         client_socket = accept(server_socket, (struct sockaddr*)&client_addr, &addr_size);
         if (client_socket == -1) {
             perror("Client connection failed");
             continue;
         }
-        if (active_clients >= MAX_CLIENTS) {
+        if (atomic_fetch_add(&active_clients, 1) >= max_clients) {
+            atomic_fetch_sub(&active_clients, 1);
             printf("Max clients reached. Rejecting connection.\n");
             close(client_socket);
             continue;
         }
-        active_clients++;
+        setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
         pthread_t thread;
         if (pthread_create(&thread, NULL, handle_client, (void*)(intptr_t)client_socket) != 0) {
             perror("Thread creation failed");
             close(client_socket);
-            active_clients--;
+            atomic_fetch_sub(&active_clients, 1);
+            continue;
         }
         pthread_detach(thread);
     }
+    return NULL;
+}
+
+// SO_REUSEPORT would let a second server share the port and silently split clients
+// between two unrelated file systems, so check with a plain bind first
+void check_port_free(int port) {
+    struct sockaddr_in addr;
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock == -1) {
+        perror("Socket creation failed");
+        exit(EXIT_FAILURE);
+    }
+    int on = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = INADDR_ANY;
+
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        fprintf(stderr, "Port %d is already in use, is another server running?\n", port);
+        close(sock);
+        exit(EXIT_FAILURE);
+    }
+    close(sock);
+}
+
+int open_listener(int port, int backlog, int reuse_port) {
+    struct sockaddr_in addr;
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock == -1) {
+        perror("Socket creation failed");
+        exit(EXIT_FAILURE);
+    }
+    int on = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    // several listeners on one port, the kernel spreads new connections across them
+    if (reuse_port && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1) {
+        perror("SO_REUSEPORT failed");
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = INADDR_ANY;
+
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        perror("Bind failed");
+        close(sock);
+        exit(EXIT_FAILURE);
+    }
+    if (listen(sock, backlog) == -1) {
+        perror("Listen failed");
+        close(sock);
+        exit(EXIT_FAILURE);
+    }
+    return sock;
+}
+
+// create this server's spill directory and lock it for as long as the server runs.
+// Spill files are named by table index, so two live servers must never share a directory
+void open_spill_dir(int port) {
+    char path[600];
+    snprintf(spill_instance_dir, sizeof(spill_instance_dir), "%s/%d", spill_dir, port);
+    if ((mkdir(spill_dir, 0700) == -1 && errno != EEXIST) ||
+        (mkdir(spill_instance_dir, 0700) == -1 && errno != EEXIST)) {
+        perror("Cannot create spill directory");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(path, sizeof(path), "%s/lock", spill_instance_dir);
+    // left open on purpose, the lock goes away with the process
+    int lock_fd = open(path, O_CREAT | O_RDWR, 0600);
+    if (lock_fd == -1) {
+        perror("Cannot open spill lock");
+        exit(EXIT_FAILURE);
+    }
+    if (flock(lock_fd, LOCK_EX | LOCK_NB) == -1) {
+        fprintf(stderr, "Spill directory %s is in use by another server\n", spill_instance_dir);
+        exit(EXIT_FAILURE);
+    }
+    // whatever an earlier run left behind, spill files and unfinished temporaries,
+    // belongs to a file system that is gone
+    DIR* dir = opendir(spill_instance_dir);
+    if (dir == NULL) {
+        perror("Cannot open spill directory");
+        exit(EXIT_FAILURE);
+    }
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strstr(entry->d_name, ".spill") != NULL) {
+            snprintf(path, sizeof(path), "%s/%s", spill_instance_dir, entry->d_name);
+            unlink(path);
+        }
+    }
+    closedir(dir);
+}
+
+void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-p port] [-a acceptors] [-c max_clients] [-v] [-r replication_port] [-f primary_host:replication_port]\n"
+        "          [-m memory_limit_bytes] [-d spill_dir] [-u user_quota_bytes:files] [-g group_quota_bytes:files]\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+void cleanup_file_system() {
+    pthread_mutex_lock(&file_system_lock);
+    for (int i = 0; i < file_count; i++) {
+        if (file_system[i].contentBuffer) {
+            free(file_system[i].contentBuffer);
+            file_system[i].contentBuffer = NULL;
+        }
+        free(file_system[i].block_checksums);
+        file_system[i].block_checksums = NULL;
+        if (memory_limit > 0) {
+            char path[256];
+            spill_path(&file_system[i], path, sizeof(path));
+            unlink(path);
+        }
+    }
+    pthread_mutex_unlock(&file_system_lock);
+}
+
+int main(int argc, char* argv[]) {
+    struct sockaddr_in primary_addr;
+    int port = PORT;
+    int acceptors = sysconf(_SC_NPROCESSORS_ONLN);
+    int repl_port = 0;
+    char* primary = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:a:c:vr:f:m:d:u:g:")) != -1) {
+        switch (opt) {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'a':
+            acceptors = atoi(optarg);
+            break;
+        case 'c':
+            max_clients = atoi(optarg);
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        case 'r':
+            repl_port = atoi(optarg);
+            break;
+        case 'f':
+            primary = optarg;
+            break;
+        case 'm':
+            memory_limit = atol(optarg);
+            break;
+        case 'd':
+            spill_dir = optarg;
+            break;
+        case 'u':
+            // bytes:files, either may be 0 for unlimited
+            if (sscanf(optarg, "%ld:%d", &user_quota_bytes, &user_quota_files) != 2) {
+                usage(argv[0]);
+            }
+            break;
+        case 'g':
+            if (sscanf(optarg, "%ld:%d", &group_quota_bytes, &group_quota_files) != 2) {
+                usage(argv[0]);
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (acceptors < 1) {
+        acceptors = 1;
+    }
+    if (port <= 0 || repl_port < 0 || max_clients < 1 || memory_limit < 0 ||
+        user_quota_bytes < 0 || user_quota_files < 0 || group_quota_bytes < 0 || group_quota_files < 0) {
+        usage(argv[0]);
+    }
+    if (memory_limit > 0) {
+        open_spill_dir(port);
+    }
+    if (primary != NULL) {
+        // -f host:port, follow that primary
+        char* colon = strrchr(primary, ':');
+        struct addrinfo hints = { 0 }, *res;
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        if (colon == NULL) {
+            usage(argv[0]);
+        }
+        *colon = '\0';
+        if (getaddrinfo(primary, colon + 1, &hints, &res) != 0) {
+            fprintf(stderr, "Cannot resolve primary %s\n", primary);
+            exit(EXIT_FAILURE);
+        }
+        memcpy(&primary_addr, res->ai_addr, sizeof(primary_addr));
+        freeaddrinfo(res);
+        is_replica = 1;
+    }
+    // a client or replica that goes away must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    // one listening socket per acceptor thread
+    if (acceptors > 1) {
+        check_port_free(port);
+    }
+    int server_sockets[acceptors];
+    for (int i = 0; i < acceptors; i++) {
+        server_sockets[i] = open_listener(port, SOMAXCONN, acceptors > 1);
+    }
+    printf("Server is listening on port %d with %d acceptor(s)\n", port, acceptors);
+
+    start_thread(scrub_files, NULL, "Scrub");
+    if (memory_limit > 0) {
+        start_thread(evict_files, NULL, "Evictor");
+    }
+    if (repl_port > 0) {
+        int repl_socket = open_listener(repl_port, MAX_REPLICAS, 0);
+        printf("Accepting replicas on port %d\n", repl_port);
+        start_thread(accept_replicas, (void*)(intptr_t)repl_socket, "Replication");
+        start_thread(send_heartbeats, NULL, "Heartbeat");
+    }
+    if (is_replica) {
+        signal(SIGUSR1, promote_to_primary);
+        printf("Replica of %s:%d, send SIGUSR1 to promote\n", primary, ntohs(primary_addr.sin_port));
+        start_thread(replicate_from_primary, &primary_addr, "Replica");
+    }
+
+    for (int i = 1; i < acceptors; i++) {
+        start_thread(accept_clients, (void*)(intptr_t)server_sockets[i], "Acceptor");
+    }
+    accept_clients((void*)(intptr_t)server_sockets[0]);
     cleanup_file_system();
-    close(server_socket);
+    for (int i = 0; i < acceptors; i++) {
+        close(server_sockets[i]);
+    }
     return 0;
 }
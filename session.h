@@ -0,0 +1,7 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+// session tokens shared by the server and fm_client: 32 hex characters + '\0'
+#define SESSION_TOKEN_SIZE 33
+
+#endif